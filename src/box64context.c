@@ -142,6 +142,7 @@ static void atfork_child_box64context(void)
     // Cancel FillBlock if needed
     void CancelBlock64(int need_lock);
     CancelBlock64(0);
+    ResetDynablockBuilder();
     #endif
 }
 
@@ -357,6 +358,7 @@ void FreeBox64Context(box64context_t** context)
         }
 
     #ifdef DYNAREC
+    FiniDynablockBuilder();   // no more block building in the background
     FlushZombieDynablocks();  // free all deferred-free dynablocks before my_context goes away
     #endif
 
@@ -51,6 +51,9 @@
 #include "freq.h"
 #include "hostext.h"
 #include "sysinfo.h"
+#ifdef DYNAREC
+#include "dynablock.h"
+#endif
 
 box64context_t *my_context = NULL;
 extern box64env_t box64env;
@@ -79,6 +82,9 @@ uint32_t default_gs = 0x53;
 uint32_t default_fs = 0;
 int box64_isglibc234 = 0;
 int box64_unittest_mode = 0;
+#ifdef DYNAREC
+static int box64_dynacache_build = 0;
+#endif
 sysinfo_t box64_sysinfo = { 0 };
 
 #ifdef DYNAREC
@@ -347,6 +353,7 @@ void PrintHelp() {
     PrintfFtrace(0, "\t-t, --test             run a unit test\n");
     PrintfFtrace(0, "\t--dynacache-list       list of DynaCache file and their validity\n");
     PrintfFtrace(0, "\t--dynacache-clean      remove invalid DynaCache files\n");
+    PrintfFtrace(0, "\t--dynacache-build elf  build the DynaCache of an x86_64 executable and its libraries without running it\n");
 }
 
 void KillAllInstances()
@@ -887,6 +894,17 @@ int initialize(int argc, const char **argv, char** env, x64emu_t** emulator, elf
             DynaCacheClean();
             exit(0);
         }
+        if(!strcmp(prog, "-db") || !strcmp(prog, "--dynacache-build")) {
+            #ifdef DYNAREC
+            box64_dynacache_build = 1;
+            SET_BOX64ENV(dynacache, 1);
+            prog = argv[++nextarg];
+            break;
+            #else
+            printf_log(LOG_NONE, "Dynarec not enable\n");
+            exit(1);
+            #endif
+        }
         // other options?
         if(!strcmp(prog, "--")) {
             prog = argv[++nextarg];
@@ -1558,6 +1576,10 @@ int initialize(int argc, const char **argv, char** env, x64emu_t** emulator, elf
     RelocateElfPlt(my_context->maplib, NULL, 0, 0, elf_header);
     // deferred init
     setupTraceInit();
+    #ifdef DYNAREC
+    // the DynaCache build only translates the code, nothing from the guest is run
+    if(!box64_dynacache_build)
+    #endif
     RunDeferredElfInit(emu);
     // update TLS of main elf
     RefreshElfTLS(elf_header, emu);
@@ -1570,10 +1592,44 @@ int initialize(int argc, const char **argv, char** env, x64emu_t** emulator, elf
     return 0;
 }
 
+#ifdef DYNAREC
+static void dynacacheBuildEntry(uintptr_t addr, void* data)
+{
+    int* nblocks = data;
+    if(internalDBGetBlock(NULL, addr, 1, 1, box64_is32bits, 1))
+        ++*nblocks;
+}
+
+// build the dynablocks of all entry points of the loaded elfs, without running the program, and write the DynaCache files
+static int dynacacheBuild(void)
+{
+    if(!BOX64ENV(dynarec)) {
+        printf_log(LOG_NONE, "Dynarec is disabled, cannot build DynaCache\n");
+        return -1;
+    }
+    for(int i=0; i<my_context->elfsize; ++i) {
+        if(!my_context->elfs[i])
+            continue;
+        int nblocks = 0;
+        int nentries = ElfForEachCodeEntry(my_context->elfs[i], dynacacheBuildEntry, &nblocks);
+        printf_log(LOG_NONE, "DynaCache build of %s: %d/%d entry points translated\n", ElfPath(my_context->elfs[i]), nblocks, nentries);
+    }
+    SerializeAllMapping();
+    return 0;
+}
+#endif
+
 int emulate(x64emu_t* emu, elfheader_t* elf_header)
 {
     // get entrypoint
     my_context->ep = GetEntryPoint(my_context->maplib, elf_header);
+    #ifdef DYNAREC
+    if(box64_dynacache_build) {
+        atexit(endBox64);
+        loadProtectionFromMap();
+        return dynacacheBuild();
+    }
+    #endif
 
     atexit(endBox64);
     loadProtectionFromMap();
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <assert.h>
 
 #include "os.h"
 #include "backtrace.h"
@@ -26,6 +27,7 @@
 #include "mypthread.h"
 #ifdef DYNAREC
 #include "dynablock.h"
+#include "dynarec_native.h"
 #include "dynarec/dynablock_private.h"
 #include "dynarec/native_lock.h"
 #include "dynarec/dynarec_next.h"
@@ -68,6 +70,9 @@ pthread_mutex_t     mutex_blocks;
 pthread_mutex_t     mutex_prot;
 pthread_mutex_t     mutex_blocks;
 #endif
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x200000
+#endif
 //#define TRACE_MEMSTAT
 rbtree_t* memprot = NULL;
 // guest 4K page permissions for hosts with larger pages.
@@ -94,6 +99,10 @@ static rbtree_t*  blockstree = NULL;
 #define BTYPE_LIST  0
 #define BTYPE_MAP64 2
 
+#ifdef DYNAREC
+#define DYNFREE_BINS 16 // size classes of free blocks in Dynarec maps, from 64 bytes up, power of 2 each
+#endif
+
 typedef struct blocklist_s {
     void*               block;
     size_t              maxfree;
@@ -102,6 +111,9 @@ typedef struct blocklist_s {
     uint32_t            lowest;
     uint8_t             type;
     uint8_t             is32bits;
+    #ifdef DYNAREC
+    void*               bins[DYNFREE_BINS]; // free blocks of Dynarec maps, by size class
+    #endif
 } blocklist_t;
 
 #define MMAPSIZE (512*1024)     // allocate 512kb sized blocks
@@ -1417,14 +1429,123 @@ static int alignGuestPageRange(uintptr_t* addr, size_t size, uintptr_t* end)
 }
 
 #ifdef DYNAREC
+// Free blocks of Dynarec maps are indexed in size class bins, as a double linked list stored in the free space itself
+// (free blocks are at least THRESHOLD bytes). This avoid walking all the blockmark of a map to find some free space.
+typedef struct dynfree_s {
+    blockmark_t*    prev;
+    blockmark_t*    next;
+} dynfree_t;
+
+static int dynfreeBin(size_t size)
+{
+    int bin = (63-__builtin_clzll(size|1)) - 6;
+    if(bin<0) bin = 0;
+    if(bin>=DYNFREE_BINS) bin = DYNFREE_BINS-1;
+    return bin;
+}
+
+static void dynfreeLink(blocklist_t* bl, blockmark_t* m)
+{
+    int bin = dynfreeBin(SIZE_BLOCK(m->next));
+    dynfree_t* f = (dynfree_t*)m->mark;
+    f->prev = NULL;
+    f->next = bl->bins[bin];
+    if(f->next)
+        ((dynfree_t*)f->next->mark)->prev = m;
+    bl->bins[bin] = m;
+}
+
+static void dynfreeUnlink(blocklist_t* bl, blockmark_t* m)
+{
+    dynfree_t* f = (dynfree_t*)m->mark;
+    if(f->prev)
+        ((dynfree_t*)f->prev->mark)->next = f->next;
+    else
+        bl->bins[dynfreeBin(SIZE_BLOCK(m->next))] = f->next;
+    if(f->next)
+        ((dynfree_t*)f->next->mark)->prev = f->prev;
+}
+
+// (re)build the index of a Dynarec map from its blockmark chain
+static void dynfreeRebuild(blocklist_t* bl)
+{
+    memset(bl->bins, 0, sizeof(bl->bins));
+    blockmark_t* m = (blockmark_t*)bl->block;
+    while(m->next.x32) {
+        if(!m->next.fill)
+            dynfreeLink(bl, m);
+        m = NEXT_BLOCK(m);
+    }
+}
+
+// check the index of a Dynarec map loaded from a DynaCache, only reading it, so the pages are not touched
+static int dynfreeValid(blocklist_t* bl)
+{
+    size_t nfree = 0;
+    blockmark_t* m = (blockmark_t*)bl->block;
+    while(m->next.x32) {
+        if(!m->next.fill)
+            ++nfree;
+        m = NEXT_BLOCK(m);
+    }
+    size_t nidx = 0;
+    for(int bin=0; bin<DYNFREE_BINS; ++bin) {
+        blockmark_t* prev = NULL;
+        for(m=bl->bins[bin]; m; m=((dynfree_t*)m->mark)->next) {
+            if((void*)m<bl->block || (void*)m>=bl->block+bl->size || m->next.fill)
+                return 0;
+            if(dynfreeBin(SIZE_BLOCK(m->next))!=bin || ((dynfree_t*)m->mark)->prev!=prev)
+                return 0;
+            if(++nidx>nfree)
+                return 0;
+            prev = m;
+        }
+    }
+    return nidx==nfree;
+}
+
+// find a free block of at least size bytes, first fit in the size class, or any block of a bigger size class
+static blockmark_t* dynfreeFind(blocklist_t* bl, size_t size, size_t* rsize)
+{
+    int bin = dynfreeBin(size);
+    for(; bin<DYNFREE_BINS; ++bin) {
+        blockmark_t* m = bl->bins[bin];
+        // only the size class of the request (or the last one) can have blocks too small
+        while(m && SIZE_BLOCK(m->next)<size)
+            m = ((dynfree_t*)m->mark)->next;
+        if(m) {
+            *rsize = SIZE_BLOCK(m->next);
+            return m;
+        }
+    }
+    return NULL;
+}
+
+static size_t dynfreeMax(blocklist_t* bl)
+{
+    for(int bin=DYNFREE_BINS-1; bin>=0; --bin)
+        if(bl->bins[bin]) {
+            size_t maxsize = 0;
+            for(blockmark_t* m = bl->bins[bin]; m; m = ((dynfree_t*)m->mark)->next)
+                if(SIZE_BLOCK(m->next)>maxsize)
+                    maxsize = SIZE_BLOCK(m->next);
+            return maxsize;
+        }
+    return 0;
+}
+
 typedef struct mmaplist_s {
     blocklist_t**   chunks;
     int             cap;
     int             size;
     int             has_new;
     int             dirty;
+    int             clock_chunk;    // clock hand of the eviction (BOX64_DYNAREC_CACHE_MAX): chunk index...
+    size_t          clock_offs;     // ...and offset in the chunk
 } mmaplist_t;
 
+static size_t dynarec_mapsize = 0; // total size of the Dynarec chunks currently mapped, use atomics (DelMmaplist runs without mutex_dyndump)
+
 mmaplist_t* NewMmaplist()
 {
     return (mmaplist_t*)box_calloc(1, sizeof(mmaplist_t));
@@ -1488,6 +1609,52 @@ size_t MmaplistTotalAlloc(mmaplist_t* list)
 
 int ApplyRelocs(dynablock_t* block, intptr_t delta_block, intptr_t delat_map, uintptr_t mapping_start);
 uintptr_t RelocGetNext();
+// Each Dynarec chunk is followed by a private area with the runtime state of its blocks (dbstate_t), one slot per
+// DBSTATE_GRANULE bytes of chunk. A block points to its slot. A DynaCache chunk is mapped back at its original
+// address when that range is free, so the state pointers stay valid and the chunk pages are not written to
+static_assert(sizeof(dynablock_t)>=DBSTATE_GRANULE, "two dynablocks must not share a state slot");
+static size_t DynarecStateSize(size_t chunksize)
+{
+    return ((chunksize/DBSTATE_GRANULE)*sizeof(dbstate_t)+box64_pagesize-1)&~(box64_pagesize-1);
+}
+
+void* AllocDynarecState(uintptr_t addr)
+{
+    blocklist_t* bl = (blocklist_t*)rb_get_64(rbt_dynmem, addr);
+    if(!bl)
+        return NULL;
+    dbstate_t* state = (dbstate_t*)(bl->block+bl->size) + (addr-(uintptr_t)bl->block)/DBSTATE_GRANULE;
+    memset(state, 0, sizeof(dbstate_t));
+    return state;
+}
+
+// map a chunk of size bytes with its state area, at addr if not NULL and if that range is free, anywhere else
+// the chunk is mapped from fd at offset, or anonymous if fd is -1
+static void* MmapDynarecChunk(void* addr, size_t size, int fd, off_t offset)
+{
+    size_t total = size+DynarecStateSize(size);
+    void* map = MAP_FAILED;
+    #ifdef BOX32
+    if(box64_is32bits)
+        map = box32_dynarec_mmap(total, -1, 0);
+    #endif
+    if(map==MAP_FAILED && addr) {
+        map = InternalMmap(addr, total, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        if(map!=MAP_FAILED && map!=addr) {
+            // an old kernel took it as a hint
+            InternalMunmap(map, total);
+            map = MAP_FAILED;
+        }
+    }
+    if(map==MAP_FAILED)
+        map = InternalMmap(NULL, total, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(map!=MAP_FAILED && fd!=-1 && InternalMmap(map, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_FIXED, fd, offset)!=map) {
+        InternalMunmap(map, total);
+        map = MAP_FAILED;
+    }
+    return map;
+}
+
 int MmaplistAddBlock_internal(mmaplist_t* list, void* map, void* orig, size_t size, intptr_t delta_map, uintptr_t mapping_start)
 {
     if(list->cap==list->size) {
@@ -1498,7 +1665,7 @@ int MmaplistAddBlock_internal(mmaplist_t* list, void* map, void* orig, size_t si
     #ifdef MADV_HUGEPAGE
     madvise(map, size, MADV_HUGEPAGE);
     #endif
-    setProtection_box((uintptr_t)map, size, PROT_READ | PROT_WRITE | PROT_EXEC);
+    setProtection_box((uintptr_t)map, size+DynarecStateSize(size), PROT_READ | PROT_WRITE | PROT_EXEC);
     list->chunks[i] = map;
     intptr_t delta = map - orig;
     // relocate the pointers
@@ -1513,12 +1680,14 @@ int MmaplistAddBlock_internal(mmaplist_t* list, void* map, void* orig, size_t si
         if(((blockmark_t*)p)->next.fill) {
             void** b = (void**)((blockmark_t*)p)->mark;
             // first is the address of the dynablock itself, that needs to be adjusted
-            b[0] += delta;
+            if(delta)
+                b[0] += delta;
             dynablock_t* bl = b[0];
             // now reloacte the dynablocks, all that need to be adjusted!
-            #define GO(A) if(bl->A) bl->A = ((void*)bl->A)+delta
+            #define GO(A) if(delta && bl->A) bl->A = ((void*)bl->A)+delta
             GO(block);
             GO(actual_block);
+            GO(state);
             GO(instsize);
             GO(arch);
             GO(callrets);
@@ -1533,9 +1702,10 @@ int MmaplistAddBlock_internal(mmaplist_t* list, void* map, void* orig, size_t si
             // shift the self referece to dynablock
             if(bl->block!=bl->jmpnext) {
                 void** db_ref = (bl->jmpnext-sizeof(void*));
-                *db_ref = (*db_ref)+delta;
+                if(delta)
+                    *db_ref = (*db_ref)+delta;
                 db_ref = (bl->jmpnext-sizeof(void*)+3*sizeof(void*));
-                *db_ref = native_next;
+                STORE_IF_CHANGED(*db_ref, native_next);
             }
             if(bl->gone || !bl->done) {
                 dynarec_log(LOG_DEBUG, "Skipping stale DynCache block %p for %p (done=%d, gone=%d)\n", bl, bl->x64_addr, bl->done, bl->gone);
@@ -1543,13 +1713,15 @@ int MmaplistAddBlock_internal(mmaplist_t* list, void* map, void* orig, size_t si
                 continue;
             }
             // adjust guest source addresses with delta_map
-            bl->x64_addr += delta_map;
-            bl->x64_readaddr += delta_map;
+            if(delta_map) {
+                bl->x64_addr += delta_map;
+                bl->x64_readaddr += delta_map;
+            }
             for (int j = 0; j < bl->sep_size; ++j) {
                 // SEP native entries also carry a hidden dynablock reference.
-                *(dynablock_t**)(bl->block + bl->sep[j].nat_offs - sizeof(void*)) = bl;
+                STORE_IF_CHANGED(*(dynablock_t**)(bl->block + bl->sep[j].nat_offs - sizeof(void*)), bl);
             }
-            *(uintptr_t*)(bl->jmpnext+2*sizeof(void*)) = RelocGetNext();
+            STORE_IF_CHANGED(*(uintptr_t*)(bl->jmpnext+2*sizeof(void*)), RelocGetNext());
             if(bl->relocs && bl->relocsize)
                 ApplyRelocs(bl, delta, delta_map, mapping_start);
             ClearCache(bl->jmpnext, 4*sizeof(void*));
@@ -1561,10 +1733,9 @@ int MmaplistAddBlock_internal(mmaplist_t* list, void* map, void* orig, size_t si
             } else {
                 for(int i=0; i<bl->sep_size; ++i) {
                     uint32_t x64_offs = bl->sep[i].x64_offs;
-                    if (addJumpTableIfDefault64(bl->x64_addr + x64_offs, bl->jmpnext))
-                        bl->sep[i].active = 1;
-                    else
-                        bl->sep[i].active = 0;
+                    int active = addJumpTableIfDefault64(bl->x64_addr + x64_offs, bl->jmpnext)?1:0;
+                    if(bl->sep[i].active!=active)
+                        bl->sep[i].active = active;
                 }
                 if(bl->x64_size) {
                     dynarec_log(LOG_DEBUG, "Added DynCache bl %p for %p - %p\n", bl, bl->x64_addr, bl->x64_addr+bl->x64_size);
@@ -1579,8 +1750,12 @@ int MmaplistAddBlock_internal(mmaplist_t* list, void* map, void* orig, size_t si
         }
         p = NEXT_BLOCK((blockmark_t*)p);
     }
+    // the free blocks index is made of pointers, it's still valid if the map is at its original address
+    if(delta || !dynfreeValid(list->chunks[i]))
+        dynfreeRebuild(list->chunks[i]);
     // add new block to rbtt_dynmem
     rb_set_64(rbt_dynmem, (uintptr_t)map, (uintptr_t)map+size, (uintptr_t)list->chunks[i]);
+    __atomic_add_fetch(&dynarec_mapsize, size, __ATOMIC_RELAXED);
 
     return 0;
 }
@@ -1588,13 +1763,8 @@ int MmaplistAddBlock_internal(mmaplist_t* list, void* map, void* orig, size_t si
 int MmaplistAddBlock(mmaplist_t* list, int fd, off_t offset, void* orig, size_t size, intptr_t delta_map, uintptr_t mapping_start)
 {
     if(!list) return -1;
-    void* map = MAP_FAILED;
-    #ifdef BOX32
-    if(box64_is32bits)
-        map = box32_dynarec_mmap(size, fd, offset);
-    #endif
-    if(map==MAP_FAILED)
-        map = InternalMmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE, fd, offset);
+    // at the same address as when the cache was written if possible, so nothing needs to be relocated
+    void* map = MmapDynarecChunk(orig, size, fd, offset);
     if(map==MAP_FAILED) {
         printf_log(LOG_INFO, "Failed to Mmap a block of a maplist\n");
         return -3;
@@ -1605,13 +1775,7 @@ int MmaplistAddBlock(mmaplist_t* list, int fd, off_t offset, void* orig, size_t
 int MmaplistAddCompressedBlock(mmaplist_t* list, int type, void* src, size_t src_size, void* orig, size_t size, intptr_t delta_map, uintptr_t mapping_start)
 {
     if(!list) return -1;
-    void* map = MAP_FAILED;
-    #ifdef BOX32
-    if(box64_is32bits)
-        map = box32_dynarec_mmap(size, -1, 0);
-    #endif
-    if(map==MAP_FAILED)
-        map = InternalMmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    void* map = MmapDynarecChunk(orig, size, -1, 0);
     if(map==MAP_FAILED) {
         printf_log(LOG_INFO, "Failed to Alloc a block of a maplist\n");
         return -3;
@@ -1635,6 +1799,70 @@ void MmaplistFillBlocks(mmaplist_t* list, CompressedDynaCacheBlock_t* blocks)
     }
 }
 
+static size_t MmaplistChunkProfile(blocklist_t* list, uint32_t min_hits, DynaCacheProfile_t* profile)
+{
+    void* p = list->block;
+    void* end = list->block + list->size - sizeof(blockmark_t);
+    size_t n = 0;
+    while(p<end) {
+        if(((blockmark_t*)p)->next.fill) {
+            dynablock_t* b = *(dynablock_t**)((blockmark_t*)p)->mark;
+            uint32_t hits = GetDynablockHits((uintptr_t)b->x64_addr);
+            if(b->quick)
+                hits += b->state->tier_count;  // executions counted by the quick tier
+            else if(BOX64ENV(dynarec_tiered) && !b->quick)
+                hits += BOX64ENV(dynarec_tiered_threshold);   // full tier means the block is already known to be hot
+            if(b->done && !b->gone && hits>=min_hits) {
+                if(profile) {
+                    profile[n].addr = (uintptr_t)b->x64_addr;
+                    profile[n].hits = hits;
+                    profile[n].is32bits = b->is32bits;
+                }
+                ++n;
+            }
+        }
+        p = NEXT_BLOCK((blockmark_t*)p);
+    }
+    return n;
+}
+
+size_t MmaplistNProfile(mmaplist_t* list, uint32_t min_hits)
+{
+    if(!list) return 0;
+    size_t n = 0;
+    for(int i=0; i<list->size; ++i)
+        n += MmaplistChunkProfile(list->chunks[i], min_hits, NULL);
+    return n;
+}
+
+void MmaplistFillProfile(mmaplist_t* list, uint32_t min_hits, DynaCacheProfile_t* profile)
+{
+    if(!list) return;
+    size_t n = 0;
+    for(int i=0; i<list->size; ++i)
+        n += MmaplistChunkProfile(list->chunks[i], min_hits, profile+n);
+}
+
+static void FreeMmaplistChunk(blocklist_t* chunk)
+{
+    rb_unset(rbt_dynmem, (uintptr_t)chunk->block, (uintptr_t)chunk->block+chunk->size);
+    // the blocklist_t "chunk" structure is port of the memory map, so grab info before freing the memory
+    // also need to include back the blocklist_t that is excluded from the blocklist tracking
+    void* addr = chunk->block - sizeof(blocklist_t);
+    size_t size = chunk->size + sizeof(blocklist_t);
+    int isReserved = box64_is32bits && (uintptr_t)addr>0xffffffffLL;
+    __atomic_sub_fetch(&dynarec_mapsize, size, __ATOMIC_RELAXED);
+    size += DynarecStateSize(size);  // the state area goes with the chunk
+    InternalMunmap(addr, size);
+    // check if memory should be protected and alloced for box32
+    if(isReserved) {
+        //rereserve and mark as reserved
+        if(InternalMmap(addr, size, 0, MAP_NORESERVE|MAP_ANONYMOUS|MAP_FIXED, -1, 0)!=MAP_FAILED)
+            rb_set(mapallmem, (uintptr_t)addr, (uintptr_t)addr+size, MEM_RESERVED);
+    } else
+        rb_unset(mapallmem, (uintptr_t)addr, (uintptr_t)addr+size);
+}
+
 void DelMmaplist(mmaplist_t* list)
 {
     if(!list) return;
@@ -1642,20 +1870,7 @@ void DelMmaplist(mmaplist_t* list)
         if(list->chunks[i]->size) {
             cleanDBFromAddressRange((uintptr_t)list->chunks[i]->block, list->chunks[i]->size, 1);
             DeferFreeDynablockClearRange(list->chunks[i]->block, list->chunks[i]->size);
-            rb_unset(rbt_dynmem, (uintptr_t)list->chunks[i]->block, (uintptr_t)list->chunks[i]->block+list->chunks[i]->size);
-            // the blocklist_t "chunk" structure is port of the memory map, so grab info before freing the memory
-            // also need to include back the blocklist_t that is excluded from the blocklist tracking
-            void* addr = list->chunks[i]->block - sizeof(blocklist_t);
-            size_t size = list->chunks[i]->size + sizeof(blocklist_t);
-            int isReserved = box64_is32bits && (uintptr_t)addr>0xffffffffLL;
-            InternalMunmap(addr, size);
-            // check if memory should be protected and alloced for box32
-            if(isReserved) {
-                //rereserve and mark as reserved
-                if(InternalMmap(addr, size, 0, MAP_NORESERVE|MAP_ANONYMOUS|MAP_FIXED, -1, 0)!=MAP_FAILED)
-                    rb_set(mapallmem, (uintptr_t)addr, (uintptr_t)addr+size, MEM_RESERVED);
-            } else
-                rb_unset(mapallmem, (uintptr_t)addr, (uintptr_t)addr+size);
+            FreeMmaplistChunk(list->chunks[i]);
         }
     box_free(list->chunks);
     box_free(list);
@@ -1711,43 +1926,150 @@ void UpdateBlockCreationSpeed()
     }
 }
 
+// check all blocks of the chunk where tick is old enough and in_used==0, then delete them
+// return 1 if a free space of at least size is available in the chunk after that, 0 else
+// beware that tick=0 blocks means they were never executed and should not be touched
+static int PurgeDynarecChunk(blocklist_t* bl, uint32_t age, size_t size)
+{
+    int ret = 0;
+    blockmark_t* p = bl->block;
+    blockmark_t* end = bl->block + bl->size - sizeof(blockmark_t);
+
+    while(p<end) {
+        blockmark_t *n = NEXT_BLOCK(p);
+        if(p->next.fill) {
+            dynablock_t* dynablock = *(dynablock_t**)p->mark;
+            uint32_t tick = native_lock_get_d(&dynablock->state->tick);
+            if(tick && dynablock->done && (my_context->tick > tick) && ((my_context->tick-tick)>=age)) {
+                int in_used = native_lock_get_d(&dynablock->state->in_used);
+                if(!in_used) {
+                    // free the block, but unreference it first
+                    dynarec_log(LOG_INFO/*LOG_DEBUG*/, " PurgeDynablock %p\n", dynablock);
+                    if((n<end) && !n->next.fill )
+                        n = NEXT_BLOCK(n);  //because the block will be agglomerated
+                    FreeDynablock(dynablock, 0, 1);
+                    if((bl->maxfree>=size))
+                        ret = 1;
+                }
+            }
+        }
+        p = n;
+    }
+    return ret;
+}
+
 int PurgeDynarecMap(mmaplist_t* list, size_t size)
 {
     if(cur_speed>100) return 0;   // 100 blocks / sec is a burst!
-    // check all blocks where tick is old enough and in_used==0, then delete them
-    // return 1 as soon as one block has been deleted, 0 else
-    // beware that tick=0 blocks means they were never executed and should not be touched
+    // return 1 as soon as a chunk has enough free space, 0 else
     int ret = 0;
-    for(int i=0; i<list->size && !ret; ++i) {
+    for(int i=0; i<list->size && !ret; ++i)
+        ret = PurgeDynarecChunk(list->chunks[i], BOX64ENV(dynarec_purge_age), size);
+    return ret;
+}
+
+// unmap the chunks that are now completely free, to give the memory back
+static void ReleaseEmptyDynarecMap(mmaplist_t* list)
+{
+    int j = 0;
+    for(int i=0; i<list->size; ++i) {
         blocklist_t* bl = list->chunks[i];
+        if(bl->maxfree == bl->size-2*sizeof(blockmark_t)) {
+            dynarec_log(LOG_INFO, "Custommem: release empty Dynarec chunk %p-%p from %p\n", bl, bl->block+bl->size, list);
+            FreeMmaplistChunk(bl);
+        } else
+            list->chunks[j++] = bl;
+    }
+    list->size = j;
+}
+
+// Eviction when the Dynarec chunks are over BOX64_DYNAREC_CACHE_MAX
+// Each list has a clock hand going through its blocks: the blocks not executed for age block creations and not
+// running are evicted, the others are left for the next turn (their tick is the "recently used" information).
+// Only a batch is evicted per allocation miss, and through FreeDynablock, so the zombie ring frees them later
+#define EVICT_BATCH     32          // max blocks evicted from a list per allocation miss
+#define EVICT_EXTRA     (64*1024)   // evict a bit more than needed, so the next allocations find some room
+typedef struct evict_s {
+    uint32_t    age;
+    size_t      target;     // bytes to evict
+    size_t      done;       // bytes evicted so far
+    mmaplist_t* keep;       // the list that needs room: its empty chunks are kept
+} evict_t;
+
+static void EvictDynarecList(mmaplist_t* list, void* data)
+{
+    evict_t* ev = (evict_t*)data;
+    dynablock_t* victims[EVICT_BATCH];
+    int nv = 0;
+    if(list->clock_chunk>=list->size) {
+        list->clock_chunk = 0;
+        list->clock_offs = 0;
+    }
+    // one full turn at most: the last step goes back to the start chunk, up to where the hand was
+    int c = list->clock_chunk;
+    size_t hand = list->clock_offs;
+    for(int k=0; k<=list->size && nv<EVICT_BATCH && ev->done<ev->target; ++k, c=(c+1)%list->size) {
+        blocklist_t* bl = list->chunks[c];
         blockmark_t* p = bl->block;
         blockmark_t* end = bl->block + bl->size - sizeof(blockmark_t);
-
-        while(p<end) {
-            blockmark_t *n = NEXT_BLOCK(p);
-            if(p->next.fill) {
-                dynablock_t* dynablock = *(dynablock_t**)p->mark;
-                int tick = native_lock_get_d(&dynablock->tick);
-                if(tick && dynablock->done && (my_context->tick > tick) && ((my_context->tick-tick)>=BOX64ENV(dynarec_purge_age))) {
-                    int in_used = native_lock_get_d(&dynablock->in_used);
-                    if(!in_used) {
-                        // free the block, but unreference it first
-                        //if(setJumpTableDefaultIfRef64(dynablock->x64_addr, dynablock->block))
-                        {
-                            dynarec_log(LOG_INFO/*LOG_DEBUG*/, " PurgeDynablock %p\n", dynablock);
-                            if((n<end) && !n->next.fill )
-                                n = NEXT_BLOCK(n);  //because the block will be agglomerated
-                            FreeDynablock(dynablock, 0, 1);
-                            if((bl->maxfree>=size))
-                                ret = 1;
-                        } // fail to set default jump, so skipping
-                    }
+        size_t from = k?0:hand;
+        size_t to = (k==list->size)?hand:bl->size;
+        while(p<end && (size_t)((uintptr_t)p-(uintptr_t)bl->block)<to && nv<EVICT_BATCH && ev->done<ev->target) {
+            blockmark_t* n = NEXT_BLOCK(p);
+            if(p->next.fill && (size_t)((uintptr_t)p-(uintptr_t)bl->block)>=from) {
+                dynablock_t* db = *(dynablock_t**)p->mark;
+                uint32_t tick = native_lock_get_d(&db->state->tick);
+                if(tick && db->done && !db->gone && (my_context->tick>tick) && ((my_context->tick-tick)>=ev->age)
+                   && !native_lock_get_d(&db->state->in_used)) {
+                    victims[nv++] = db;
+                    ev->done += (uintptr_t)n-(uintptr_t)p;
                 }
             }
             p = n;
         }
+        list->clock_chunk = c;
+        list->clock_offs = (uintptr_t)p-(uintptr_t)bl->block;
+    }
+    // the chunks are not walked anymore, the blocks can go now
+    for(int i=0; i<nv; ++i) {
+        dynarec_log(LOG_DEBUG, " EvictDynablock %p\n", victims[i]);
+        FreeDynablock(victims[i], 0, 1);
+    }
+    if(list!=ev->keep)
+        ReleaseEmptyDynarecMap(list);
+}
+
+// The Dynarec chunks are over BOX64_DYNAREC_CACHE_MAX: evict a batch of blocks, starting with list, then the
+// other lists (the global one and the per-mapping ones), and give back the chunks that end up empty
+// If nothing is old enough, the blocks not executed since the last block creation are taken
+// return 1 if list now has a chunk with at least size free
+static int EvictDynarecMap(mmaplist_t* list, size_t size)
+{
+    evict_t ev = {0};
+    ev.age = BOX64ENV(dynarec_purge_age);
+    ev.target = size+EVICT_EXTRA;
+    ev.keep = list;
+    for(int pass=0; pass<2 && !ev.done; ++pass) {
+        EvictDynarecList(list, &ev);
+        ForEachMappingMmaplist(EvictDynarecList, &ev);
+        if(mmaplist && mmaplist!=list)
+            EvictDynarecList(mmaplist, &ev);
+        ev.age = 1;
     }
-    return ret;
+    for(int i=0; i<list->size; ++i)
+        if(list->chunks[i]->maxfree>=size)
+            return 1;
+    return 0;
+}
+
+// size of the next chunk to map for list, to hold need_sz bytes
+static size_t DynarecChunkSize(mmaplist_t* list, size_t need_sz)
+{
+    size_t allocsize = list->size?DYNMMAPSZ:DYNMMAPSZ0;
+    if(need_sz>allocsize)
+        allocsize = need_sz;
+    // allign sz with pagesize
+    return (allocsize+(box64_pagesize-1))&~(box64_pagesize-1);
 }
 #ifdef TRACE_MEMSTAT
 static uint64_t dynarec_allocated = 0;
@@ -1759,7 +2081,7 @@ uintptr_t AllocDynarecMap(uintptr_t x64_addr, size_t size, int is_new)
 
     size = roundSize(size);
 
-    if(BOX64ENV(dynarec_purge)) {
+    if(BOX64ENV(dynarec_purge) || BOX64ENV(dynarec_cache_max)) {
         __atomic_fetch_add(&my_context->tick, 1, __ATOMIC_RELAXED);
         UpdateBlockCreationSpeed();
     }
@@ -1776,39 +2098,48 @@ uintptr_t AllocDynarecMap(uintptr_t x64_addr, size_t size, int is_new)
     int recheck = 0;
     do {
         for(int i=0; i<list->size; ++i) {
-            if(list->chunks[i]->maxfree>=size) {
+            blocklist_t* bl = list->chunks[i];
+            if(bl->maxfree>=size) {
                 // looks free, try to alloc!
                 size_t rsize = 0;
-                void* sub = getFirstBlock(list->chunks[i]->block, size, &rsize, list->chunks[i]->first);
+                blockmark_t* sub = dynfreeFind(bl, size, &rsize);
                 if(sub) {
-                    void* ret = allocBlock(list->chunks[i]->block, sub, size, &list->chunks[i]->first);
-                    if(rsize==list->chunks[i]->maxfree)
-                        list->chunks[i]->maxfree = getMaxFreeBlock(list->chunks[i]->block, list->chunks[i]->size, list->chunks[i]->first);
+                    dynfreeUnlink(bl, sub);
+                    void* ret = allocBlock(bl->block, sub, size, &bl->first);
+                    blockmark_t* n = NEXT_BLOCK(sub);
+                    if(n->next.x32 && !n->next.fill)
+                        dynfreeLink(bl, n); // the remaining of the free block
+                    if(rsize==bl->maxfree)
+                        bl->maxfree = dynfreeMax(bl);
                     //rb_set_64(list->chunks[i].tree, (uintptr_t)ret, (uintptr_t)ret+size, (uintptr_t)ret);
                     return (uintptr_t)ret;
                 }
             }
         }
         // check if we can remove blocks before allocating a new one
-        if(BOX64ENV(dynarec_purge))
-            recheck = recheck?0:PurgeDynarecMap(list, size);  // don't do purge all the time, it's too time consuming
+        if(recheck)
+            recheck = 0;
+        else if(BOX64ENV(dynarec_cache_max) && __atomic_load_n(&dynarec_mapsize, __ATOMIC_RELAXED)+DynarecChunkSize(list, sz+sizeof(blocklist_t))>(size_t)BOX64ENV(dynarec_cache_max)*1024*1024) {
+            // over budget: evict old blocks instead of growing
+            recheck = EvictDynarecMap(list, size);
+        } else if(BOX64ENV(dynarec_purge))
+            recheck = PurgeDynarecMap(list, size);  // don't do purge all the time, it's too time consuming
     } while(recheck);
+    // alloc a new block, aversized or not, we are at the end of the list
+    size_t allocsize = DynarecChunkSize(list, sz + sizeof(blocklist_t));
+    size_t mapsize = __atomic_load_n(&dynarec_mapsize, __ATOMIC_RELAXED);
+    if(BOX64ENV(dynarec_cache_max) && mapsize+allocsize>(size_t)BOX64ENV(dynarec_cache_max)*1024*1024) {
+        // the budget is hard: no block this time, the code runs on the interpreter until some room is freed
+        dynarec_log(LOG_DEBUG, "Custommem: Dynarec cache over budget (%zu kB), no room for %zu bytes\n", (mapsize+allocsize)/1024, size);
+        return 0;
+    }
     // need to add a new
     if(list->size == list->cap) {
         list->cap+=4;
         list->chunks = box_realloc(list->chunks, list->cap*sizeof(blocklist_t**));
     }
     int i = list->size++;
-    size_t need_sz = sz + sizeof(blocklist_t);
-    // alloc a new block, aversized or not, we are at the end of the list
-    size_t allocsize = (need_sz>(i?DYNMMAPSZ:DYNMMAPSZ0))?need_sz:(i?DYNMMAPSZ:DYNMMAPSZ0);
-    // allign sz with pagesize
-    allocsize = (allocsize+(box64_pagesize-1))&~(box64_pagesize-1);
     void* p=MAP_FAILED;
-    #ifdef BOX32
-    if(box64_is32bits)
-        p = box32_dynarec_mmap(allocsize, -1, 0);
-    #endif
     // disabling for now. explicit hugepage needs to be enabled to be used on userspace
     // with`/sys/kernel/mm/hugepages/hugepages-2048kB/nr_hugepages` as the number of allowaed 2M huge page
     // At least with a 2M allocation, transparent huge page should kick-in
@@ -1820,7 +2151,7 @@ uintptr_t AllocDynarecMap(uintptr_t x64_addr, size_t size, int is_new)
     }
     #endif
     if(p==MAP_FAILED)
-        p = InternalMmap(NULL, allocsize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        p = MmapDynarecChunk(NULL, allocsize, -1, 0);
     if(p==MAP_FAILED) {
         dynarec_log(LOG_INFO, "Cannot create dynamic map of %zu bytes (%s)\n", allocsize, strerror(errno));
         return 0;
@@ -1835,9 +2166,10 @@ uintptr_t AllocDynarecMap(uintptr_t x64_addr, size_t size, int is_new)
     if(box64env.dynarec_log>LOG_INFO || box64env.dynarec_dump)
         dynarec_log(LOG_NONE, "Custommem: allocation %p-%p for Dynarec %p->chunk[%d]\n", p, p+allocsize, list, i);
 #endif
-    setProtection_box((uintptr_t)p, allocsize, PROT_READ | PROT_WRITE | PROT_EXEC);
+    setProtection_box((uintptr_t)p, allocsize+DynarecStateSize(allocsize), PROT_READ | PROT_WRITE | PROT_EXEC);
     list->chunks[i] = p;
     rb_set_64(rbt_dynmem, (uintptr_t)p, (uintptr_t)p+allocsize, (uintptr_t)list->chunks[i]);
+    __atomic_add_fetch(&dynarec_mapsize, allocsize, __ATOMIC_RELAXED);
     p = p + sizeof(blocklist_t);    // adjust pointer and size, to exclude blocklist_t itself
     allocsize-=sizeof(blocklist_t);
     list->chunks[i]->block = p;
@@ -1856,6 +2188,7 @@ uintptr_t AllocDynarecMap(uintptr_t x64_addr, size_t size, int is_new)
     list->chunks[i]->maxfree = getMaxFreeBlock(list->chunks[i]->block, list->chunks[i]->size, list->chunks[i]->first);
     if(list->chunks[i]->maxfree)
         list->chunks[i]->first = getNextFreeBlock(m);
+    dynfreeRebuild(list->chunks[i]);
     //rb_set_64(list->chunks[i].tree, (uintptr_t)ret, (uintptr_t)ret+size, (uintptr_t)ret);
     return (uintptr_t)ret;
 }
@@ -1869,8 +2202,18 @@ void FreeDynarecMap(uintptr_t addr)
     blocklist_t* bl = (blocklist_t*)rb_get_64(rbt_dynmem, addr);
 
     if(bl) {
-        void* sub = (void*)(addr-sizeof(blockmark_t));
+        blockmark_t* sub = (blockmark_t*)(addr-sizeof(blockmark_t));
+        // free neighbours will be merged, so remove them from the index first
+        blockmark_t* n = NEXT_BLOCK(sub);
+        if(n->next.x32 && !n->next.fill)
+            dynfreeUnlink(bl, n);
+        blockmark_t* s = sub;
+        if(sub->prev.x32 && !sub->prev.fill) {
+            s = PREV_BLOCK(sub);
+            dynfreeUnlink(bl, s);
+        }
         size_t newfree = freeBlock(bl->block, bl->size, sub, &bl->first);
+        dynfreeLink(bl, s);
         if(bl->maxfree < newfree)
             bl->maxfree = newfree;
         return;
@@ -1942,6 +2285,10 @@ int cleanDBFromAddressRange(uintptr_t addr, size_t size, int destroy)
     dynablock_t* db = NULL;
     uintptr_t end = addr+size;
     int ret = 0;
+    if(destroy==1) {
+        ForgetTierDynablock(addr, size);
+        ForgetDynablockHits(addr, size);
+    }
     while (start_addr<end) {
         start_addr = getDBSize(start_addr, end-start_addr, &db);
         if(db) {
@@ -3364,9 +3711,6 @@ void getLockAddressRange(uintptr_t start, size_t size, uintptr_t addrs[])
 }
 #endif
 
-#ifndef MAP_FIXED_NOREPLACE
-#define MAP_FIXED_NOREPLACE 0x200000
-#endif
 #ifndef MAP_32BIT
 #define MAP_32BIT 0x40
 #endif
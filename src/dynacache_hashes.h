@@ -0,0 +1,19 @@
+/* Auto-generated by tools/gen_dynacache_hashes.py. Do not edit. */
+#ifndef __DYNACACHE_HASHES_H__
+#define __DYNACACHE_HASHES_H__
+
+#define DYNAREC_VERSION 0x4D1DFFu
+
+#if defined(ARM64)
+#define ARCH_VERSION 0x0FBF97u
+#elif defined(RV64)
+#define ARCH_VERSION 0xAF2850u
+#elif defined(LA64)
+#define ARCH_VERSION 0x4989B9u
+#elif defined(PPC64LE)
+#define ARCH_VERSION 0xFCAF83u
+#else
+#error Unsupported architecture
+#endif
+
+#endif
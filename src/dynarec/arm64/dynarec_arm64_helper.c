@@ -2860,8 +2860,10 @@ void doEnterBlock(dynarec_arm_t* dyn, int ninst, int s1, int s2, int s3)
     MESSAGE(LOG_INFO, "doEnter --------\n");
     int delta = -(dyn->native_size + sizeof(void*));
     LDRx_literal(s1, delta);
+    // the runtime counters are in the private state of the block, not in the block itself
+    LDRx_U12(s1, s1, offsetof(dynablock_t, state));
     // now increment in_used
-    ADDx_U12(s1, s1, offsetof(dynablock_t, in_used));
+    ADDx_U12(s1, s1, offsetof(dbstate_t, in_used));
     if(cpuext.atomics) {
         MOV32w(s3, 1);
         STADDLw(s3, s1);
@@ -2874,7 +2876,7 @@ void doEnterBlock(dynarec_arm_t* dyn, int ninst, int s1, int s2, int s3)
     // set tick
     LDRx_U12(s2, xEmu, offsetof(x64emu_t, context));
     LDRw_U12(s2, s2, offsetof(box64context_t, tick));
-    STRw_U12(s2, s1, offsetof(dynablock_t, tick)-offsetof(dynablock_t, in_used));
+    STRw_U12(s2, s1, offsetof(dbstate_t, tick)-offsetof(dbstate_t, in_used));
     MESSAGE(LOG_INFO, "-------- doEnter\n");
 }
 void doLeaveBlock(dynarec_arm_t* dyn, int ninst, int s1, int s2, int s3)
@@ -2883,7 +2885,8 @@ void doLeaveBlock(dynarec_arm_t* dyn, int ninst, int s1, int s2, int s3)
     // get dynarec address
     int delta = -(dyn->native_size + sizeof(void*));
     LDRx_literal(s1, delta);
-    ADDx_U12(s1, s1, offsetof(dynablock_t, in_used));
+    LDRx_U12(s1, s1, offsetof(dynablock_t, state));
+    ADDx_U12(s1, s1, offsetof(dbstate_t, in_used));
     // decrement in_used
     if(cpuext.atomics) {
         MOV32w(s3, -1);
@@ -2990,3 +2993,22 @@ void checkCRC(dynarec_arm_t* dyn, int ninst)
     TABLE64C(x3, const_native_next_invalidate);
     BLR(x3);
 }
+
+void doTierCount(dynarec_arm_t* dyn, int ninst, int s1, int s2, int s3)
+{
+    MESSAGE(LOG_INFO, "TierCount --------\n");
+    // get dynarec address. It is stored just before the start of the block
+    int delta = -(dyn->native_size + sizeof(void*));
+    LDRx_literal(s1, delta);
+    LDRx_U12(s1, s1, offsetof(dynablock_t, state));
+    // no need for atomic here, an approximate count is enough
+    LDRw_U12(s2, s1, offsetof(dbstate_t, tier_count));
+    ADDw_U12(s2, s2, 1);
+    STRw_U12(s2, s1, offsetof(dbstate_t, tier_count));
+    MOV32w(s3, BOX64ENV(dynarec_tiered_threshold));
+    CMPSw_REG(s2, s3);
+    Bcond(cCC, 4+2*4);
+    TABLE64C(s3, const_native_next_invalidate);
+    BLR(s3);
+    MESSAGE(LOG_INFO, "-------- TierCount\n");
+}
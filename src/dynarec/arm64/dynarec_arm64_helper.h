@@ -1299,6 +1299,7 @@
 #define doEnterBlock      STEPNAME(doEnterBlock)
 #define doLeaveBlock      STEPNAME(doLeaveBlock)
 #define checkCRC          STEPNAME(checkCRC)
+#define doTierCount       STEPNAME(doTierCount)
 
 #define fpu_pushcache   STEPNAME(fpu_pushcache)
 #define fpu_popcache    STEPNAME(fpu_popcache)
@@ -1578,6 +1579,8 @@ void doEnterBlock(dynarec_arm_t* dyn, int ninst, int s1, int s2, int s3);
 void doLeaveBlock(dynarec_arm_t* dyn, int ninst, int s1, int s2, int s3);
 // in case of allways_test, this insert a check of crc of the dynablock (and exit to ArmNext if wrong)
 void checkCRC(dynarec_arm_t* dyn, int ninst);
+// for quick tier block, count down the executions and exit to ArmNextInvalid when the block is hot, to rebuild it
+void doTierCount(dynarec_arm_t* dyn, int ninst, int s1, int s2, int s3);
 
 uintptr_t dynarec64_00(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst, rex_t rex, int* ok, int* need_epilog);
 uintptr_t dynarec64_0F(dynarec_arm_t* dyn, uintptr_t addr, uintptr_t ip, int ninst, rex_t rex, int* ok, int* need_epilog);
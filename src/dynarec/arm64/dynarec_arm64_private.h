@@ -214,6 +214,7 @@ typedef struct dynarec_arm_s {
     uint8_t             use_ymm:1;
     uint8_t             have_purge:1;   // set to 1 if block can be purged
     uint8_t             is_file_mapped:1;   // if the memory is a mapped file (probably binary, not a memory)
+    uint8_t             quick:1;    // quick tier block, rebuilt with full optimisations when hot
     void*               gdbjit_block;
     uint32_t            need_x87check;  // needs x87 precision control check if non-null, or 0 if not
     uint32_t            need_dump;     // need to dump the block
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <signal.h>
+#include <pthread.h>
 
 #include "os.h"
 #include "debug.h"
@@ -225,8 +226,8 @@ int FreeRangeDynablock(dynablock_t* db, uintptr_t addr, uintptr_t size)
 void dynablock_leave_runtime(dynablock_t* db)
 {
     if(!db) return;
-    if(!db->tick) return;
-    __atomic_fetch_sub(&db->in_used, 1, __ATOMIC_ACQ_REL);
+    if(!db->state->tick) return;
+    __atomic_fetch_sub(&db->state->in_used, 1, __ATOMIC_ACQ_REL);
 }
 
 dynablock_t* CreateDBnoAlt(x64emu_t* emu, uintptr_t addr, int is32bits)
@@ -269,6 +270,212 @@ dynablock_t* CreateDBnoAlt(x64emu_t* emu, uintptr_t addr, int is32bits)
     return block;
 }
 
+// ---- Background building of dynablocks
+// When BOX64_DYNAREC_WAIT=0, a thread that cannot get mutex_dyndump does not wait and runs the interpreter.
+// With BOX64_DYNAREC_BACKGROUND, the wanted address is queued instead, and a single builder thread builds the block
+// and publish it in the jumptable, so the guest thread will pick it up on its next dispatch.
+// There is only one builder: the passes use static state and run under mutex_dyndump, so more threads would just wait.
+KHASH_SET_INIT_INT64(dbjobs)
+typedef struct dbjob_s {
+    uintptr_t   addr;
+    int         is32bits;
+} dbjob_t;
+#define DBJOBS_SIZE     1024
+static dbjob_t          dbjobs[DBJOBS_SIZE];
+static int              dbjobs_head = 0;
+static int              dbjobs_count = 0;
+static kh_dbjobs_t*     dbjobs_pending = NULL;
+static pthread_mutex_t  mutex_dbjobs = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   cond_dbjobs = PTHREAD_COND_INITIALIZER;
+static pthread_t        dbbuilder;
+static int              dbbuilder_running = 0;
+static int              dbbuilder_quit = 0;
+
+static void* dynablock_builder(void* arg)
+{
+    (void)arg;
+    // only keep the signals needed to cancel a FillBlock
+    sigset_t sigs;
+    sigfillset(&sigs);
+    sigdelset(&sigs, SIGSEGV);
+    sigdelset(&sigs, SIGILL);
+    sigdelset(&sigs, SIGBUS);
+    sigdelset(&sigs, SIGFPE);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    while(1) {
+        pthread_mutex_lock(&mutex_dbjobs);
+        while(!dbjobs_count && !dbbuilder_quit)
+            pthread_cond_wait(&cond_dbjobs, &mutex_dbjobs);
+        if(dbbuilder_quit) {
+            pthread_mutex_unlock(&mutex_dbjobs);
+            return NULL;
+        }
+        dbjob_t job = dbjobs[dbjobs_head];
+        dbjobs_head = (dbjobs_head+1)%DBJOBS_SIZE;
+        --dbjobs_count;
+        pthread_mutex_unlock(&mutex_dbjobs);
+        // build the block (if still needed). The jumptable is filled by internalDBGetBlock
+        mutex_lock(&my_context->mutex_dyndump);
+        dynablock_t* db = internalDBGetBlock(NULL, job.addr, 1, 0, job.is32bits, 1);
+        mutex_unlock(&my_context->mutex_dyndump);
+        dynarec_log(LOG_DEBUG, "%04d| Builder built block %p for %p\n", GetTID(), db, (void*)job.addr);
+        pthread_mutex_lock(&mutex_dbjobs);
+        khint_t k = kh_get(dbjobs, dbjobs_pending, job.addr);
+        if(k!=kh_end(dbjobs_pending))
+            kh_del(dbjobs, dbjobs_pending, k);
+        pthread_mutex_unlock(&mutex_dbjobs);
+    }
+    return NULL;
+}
+
+static void EnqueueDynablock(uintptr_t addr, int is32bits)
+{
+    pthread_mutex_lock(&mutex_dbjobs);
+    if(!dbjobs_pending)
+        dbjobs_pending = kh_init(dbjobs);
+    int ret;
+    kh_put(dbjobs, dbjobs_pending, addr, &ret);
+    if(!ret || dbjobs_count==DBJOBS_SIZE) {
+        // already queued, or queue full (the interpreter will just try again later)
+        if(ret)
+            kh_del(dbjobs, dbjobs_pending, kh_get(dbjobs, dbjobs_pending, addr));
+        pthread_mutex_unlock(&mutex_dbjobs);
+        return;
+    }
+    dbjobs[(dbjobs_head+dbjobs_count)%DBJOBS_SIZE].addr = addr;
+    dbjobs[(dbjobs_head+dbjobs_count)%DBJOBS_SIZE].is32bits = is32bits;
+    ++dbjobs_count;
+    // the builder is started lazily
+    if(!dbbuilder_running) {
+        if(pthread_create(&dbbuilder, NULL, dynablock_builder, NULL))
+            printf_log(LOG_INFO, "Warning, cannot create Dynarec builder thread\n");
+        else
+            dbbuilder_running = 1;
+    }
+    pthread_cond_signal(&cond_dbjobs);
+    pthread_mutex_unlock(&mutex_dbjobs);
+}
+
+void ResetDynablockBuilder(void)
+{
+    // after a fork, the builder thread is gone, and the job queue state is not trustable
+    pthread_mutex_init(&mutex_dbjobs, NULL);
+    pthread_cond_init(&cond_dbjobs, NULL);
+    dbjobs_head = dbjobs_count = 0;
+    if(dbjobs_pending)
+        kh_clear(dbjobs, dbjobs_pending);
+    dbbuilder_running = 0;
+    dbbuilder_quit = 0;
+}
+
+void FiniDynablockBuilder(void)
+{
+    if(!dbbuilder_running)
+        return;
+    pthread_mutex_lock(&mutex_dbjobs);
+    dbbuilder_quit = 1;
+    pthread_cond_broadcast(&cond_dbjobs);
+    pthread_mutex_unlock(&mutex_dbjobs);
+    pthread_join(dbbuilder, NULL);
+    dbbuilder_running = 0;
+    dbjobs_count = 0;
+    if(dbjobs_pending) {
+        kh_destroy(dbjobs, dbjobs_pending);
+        dbjobs_pending = NULL;
+    }
+}
+
+// ---- Dispatch counts for the DynaCache profile
+// Only the dispatch misses (LinkNext) are counted: chained blocks don't come back to C. The counts are kept
+// here and not in the dynablock_t, so the blocks loaded from a DynaCache are not written to on dispatch.
+// It's a fixed open addressed array, lock free: a slot is claimed with a CAS on its address, and an entry
+// point that doesn't find a slot in DBHITS_PROBE tries is simply not counted
+typedef struct dbhits_s {
+    uintptr_t   addr;
+    uint32_t    count;
+} dbhits_t;
+#define DBHITS_SIZE     65536   // power of 2, don't track more entry points than that
+#define DBHITS_PROBE    8
+static dbhits_t*        dbhits = NULL;
+
+static inline uint32_t dbhitsHash(uintptr_t addr)
+{
+    uint64_t h = (uint64_t)addr * 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(h>>32)&(DBHITS_SIZE-1);
+}
+
+void CountDynablockHit(uintptr_t addr)
+{
+    dbhits_t* hits = __atomic_load_n(&dbhits, __ATOMIC_ACQUIRE);
+    if(!hits) {
+        dbhits_t* tmp = (dbhits_t*)box_calloc(DBHITS_SIZE, sizeof(dbhits_t));
+        if(!__atomic_compare_exchange_n(&dbhits, &hits, tmp, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            box_free(tmp);  // some other thread was faster
+        else
+            hits = tmp;
+    }
+    uint32_t h = dbhitsHash(addr);
+    for(int i=0; i<DBHITS_PROBE; ++i) {
+        dbhits_t* e = &hits[(h+i)&(DBHITS_SIZE-1)];
+        uintptr_t cur = __atomic_load_n(&e->addr, __ATOMIC_ACQUIRE);
+        if(!cur && __atomic_compare_exchange_n(&e->addr, &cur, addr, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            cur = addr;
+        if(cur==addr) {
+            if(__atomic_load_n(&e->count, __ATOMIC_RELAXED)!=UINT32_MAX)
+                __atomic_fetch_add(&e->count, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
+
+uint32_t GetDynablockHits(uintptr_t addr)
+{
+    dbhits_t* hits = __atomic_load_n(&dbhits, __ATOMIC_ACQUIRE);
+    if(!hits)
+        return 0;
+    uint32_t h = dbhitsHash(addr);
+    for(int i=0; i<DBHITS_PROBE; ++i) {
+        dbhits_t* e = &hits[(h+i)&(DBHITS_SIZE-1)];
+        if(__atomic_load_n(&e->addr, __ATOMIC_ACQUIRE)==addr)
+            return __atomic_load_n(&e->count, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+void ForgetDynablockHits(uintptr_t addr, size_t size)
+{
+    dbhits_t* hits = __atomic_load_n(&dbhits, __ATOMIC_ACQUIRE);
+    if(!hits)
+        return;
+    // the count is cleared before the slot is released, a racing CountDynablockHit can at worst lose a hit
+    for(int i=0; i<DBHITS_SIZE; ++i) {
+        uintptr_t cur = __atomic_load_n(&hits[i].addr, __ATOMIC_ACQUIRE);
+        if(cur && cur>=addr && cur-addr<size) {
+            __atomic_store_n(&hits[i].count, 0, __ATOMIC_RELAXED);
+            __atomic_compare_exchange_n(&hits[i].addr, &cur, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Hot entry point coming from a DynaCache profile: ask for a full optimised block there,
+// and build it in background if no block exists yet (needs BOX64_DYNAREC_BACKGROUND)
+// A quick block already there is invalidated the usual way, not patched, as it may be in a DynaCache mapping
+void ProfileDynablock(uintptr_t addr, int is32bits)
+{
+    mutex_lock(&my_context->mutex_dyndump);
+    dynablock_t* db = getDB(addr);
+    if(BOX64ENV(dynarec_tiered)) {
+        TierUpDynablock(addr);
+        if(db && db->quick && db->done && !db->gone) {
+            FreeInvalidDynablock(InvalidDynablock(db, 0), 0);
+            db = NULL;
+        }
+    }
+    mutex_unlock(&my_context->mutex_dyndump);
+    if(!db && BOX64ENV(dynarec_background))
+        EnqueueDynablock(addr, is32bits);
+}
+
 /* 
     return NULL if block is not found / cannot be created. 
     Don't create if create==0
@@ -313,6 +520,8 @@ dynablock_t* internalDBGetBlock(x64emu_t* emu, uintptr_t addr, int create, int n
         } else {
             if(mutex_trylock(&my_context->mutex_dyndump)) {   // FillBlock not available for now
                 pthread_sigmask(SIG_SETMASK, &old_sig, NULL);
+                if(BOX64ENV(dynarec_background))
+                    EnqueueDynablock(addr, is32bits);
                 return NULL;
             }
         }
@@ -378,7 +587,8 @@ void FlushZombieDynablocks(void)
     int head = my_context->db_zombie_head;
     for (int i = 0; i < my_context->db_zombie_count; ++i) {
         int idx = (head - my_context->db_zombie_count + i + DB_ZOMBIE_SIZE) % DB_ZOMBIE_SIZE;
-        FreeDynarecMap((uintptr_t)my_context->db_zombie[idx]->actual_block);
+        if(my_context->db_zombie[idx])
+            FreeDynarecMap((uintptr_t)my_context->db_zombie[idx]->actual_block);
     }
     my_context->db_zombie_count = 0;
 }
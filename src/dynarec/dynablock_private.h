@@ -17,11 +17,19 @@ typedef struct sep_s {
     uint32_t    x64_offs;
 } sep_t;
 
+// the per-process state of a block, written at runtime. It's in a private area right after the chunk of the block,
+// so the chunks mapped from a DynaCache file are not written to and stay shared between processes
+#define DBSTATE_GRANULE 128 // a chunk has a state slot per DBSTATE_GRANULE bytes, no block allocation is smaller
+typedef struct dbstate_s {
+    uint32_t            in_used;    // will be 0 if not in_used, >0 if used be some code
+    uint32_t            tick;       // last "tick" when dynablock was run
+    uint32_t            tier_count; // for quick blocks, executions counted, it's rebuilt with full optimisations at BOX64_DYNAREC_TIERED_THRESHOLD
+} dbstate_t;
+
 typedef struct dynablock_s {
     void*           block;  // block-sizeof(void*) == self
     void*           actual_block;   // the actual start of the block (so block-sizeof(void*))
-    uint32_t        in_used;// will be 0 if not in_used, >0 if used be some code
-    uint32_t        tick;    // last "tick" when dynablock was run
+    dbstate_t*      state;  // runtime state, out of the chunk
     void*           x64_addr;
     uintptr_t       x64_size;
     size_t          native_size;
@@ -36,6 +44,7 @@ typedef struct dynablock_s {
     uint8_t         is32bits:1;
     uint8_t         autocrc:1;
     uint8_t         to_delete:1;
+    uint8_t         quick:1;    // built with the quick tier (BOX64_DYNAREC_TIERED)
     int             callret_size;   // size of the array
     int             isize;
     int             arch_size;  // size of of arch dependant infos
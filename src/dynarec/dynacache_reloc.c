@@ -182,24 +182,25 @@ int ApplyRelocs(dynablock_t* block, intptr_t delta_block, intptr_t delta_map, ui
         switch(relocs[i].type) {
             case RELOC_TBL64C:
                 idx = relocs[i].table64c.idx;
-                table64[idx] = getConst(relocs[i].table64c.C);
+                STORE_IF_CHANGED(table64[idx], getConst(relocs[i].table64c.C));
                 dynarec_log(LOG_DEBUG, "\tApply Relocs[%d]: TABLE64[%d]=Const:%d\n", i, idx, relocs[i].table64c.C);
                 break;
             case RELOC_TBL64ADDR:
                 idx = relocs[i].table64addr.idx;
-                table64[idx] += delta_map;
+                if(delta_map)
+                    table64[idx] += delta_map;
                 dynarec_log(LOG_DEBUG, "\tApply Relocs[%d]: TABLE64[%d]=Addr in Map, delta=%zd\n", i, idx, delta_map);
                 break;
             case RELOC_TBL64RETENDBL:
                 idx = relocs[i].table64retendbl.idx;
                 addr = (uintptr_t)block->x64_addr + block->x64_size + relocs[i].table64retendbl.delta;
-                table64[idx] = getJumpTableAddress64(addr);
+                STORE_IF_CHANGED(table64[idx], getJumpTableAddress64(addr));
                 dynarec_log(LOG_DEBUG, "\tApply Relocs[%d]: TABLE64[%d]=JmpTable64(%p)\n", i, idx, (void*)addr);
                 break;
             case RELOC_CANCELBLOCK:
                 dynarec_log(LOG_DEBUG, "\tApply Relocs[%d]: Cancel Block\n", i);
-                block->dirty = 1;
-                block->hash = 0;
+                STORE_IF_CHANGED(block->dirty, 1);
+                STORE_IF_CHANGED(block->hash, 0);
                 return 0;
             case RELOC_TBL64TBLJMPH:
                 if(relocs[i+1].type!=RELOC_TBL64TBLJMPL)
@@ -207,7 +208,7 @@ int ApplyRelocs(dynablock_t* block, intptr_t delta_block, intptr_t delta_map, ui
                 idx = relocs[i].table64jmptblh.idx;
                 addr = relocs[i].table64jmptblh.deltah;
                 addr = mapping_start + relocs[i+1].table64jmptbll.deltal + (addr<<24);
-                table64[idx] = getJumpTableAddress64(addr);
+                STORE_IF_CHANGED(table64[idx], getJumpTableAddress64(addr));
                 dynarec_log(LOG_DEBUG, "\tApply Relocs[%d,%d]: TABLE64[%d]=JmpTable64(%p)=%p\n", i, i+1, idx, (void*)addr, getJumpTableAddress64(addr));
                 break;
             case RELOC_TBL64TBLJMPL:
@@ -20,6 +20,7 @@
 #include "dynablock_private.h"
 #include "bridge.h"
 #include "dynarec_next.h"
+#include "dynarec_native.h"
 #include "custommem.h"
 #include "x64test.h"
 #endif
@@ -90,6 +91,8 @@ void* LinkNext(x64emu_t* emu, uintptr_t addr, void* x2, uintptr_t* x3)
         // null block, but done: go to epilog, no linker here
         return native_epilog;
     }
+    if(BOX64ENV(dynacache))
+        CountDynablockHit((uintptr_t)block->x64_addr);
     if(block->sep_size && (uintptr_t)block->x64_addr!=addr) {
         jblock = NULL;
         for(int i=0; i<block->sep_size && !jblock; ++i) {
@@ -111,6 +114,11 @@ void* LinkNextInvalid(x64emu_t* emu, uintptr_t addr, void* x2, uintptr_t* x3)
     dynablock_t* db = getDB(addr);
     if(db) {
         mutex_lock(&my_context->mutex_dyndump);
+        if(db->quick && db->state->tier_count>=BOX64ENV(dynarec_tiered_threshold)) {
+            // the quick block is hot now, rebuild it with full optimisations
+            dynarec_log(LOG_DEBUG, "Tier-up of block %p from %p:%p\n", db, db->x64_addr, db->x64_addr+db->x64_size-1);
+            TierUpDynablock((uintptr_t)db->x64_addr);
+        }
         db->done = 0;
         dynarec_log(LOG_DEBUG, "Invalidating block %p from %p:%p (hash:%X, gone:%d, autocrc:%d, to_delete:%d) for %p\n", db, db->x64_addr, db->x64_addr+db->x64_size, db->hash, db->gone, db->autocrc, db->to_delete, (void*)addr);
         dynablock_t* old = InvalidDynablock(db, 0);
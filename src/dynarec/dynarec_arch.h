@@ -39,6 +39,7 @@ extern void* create_updateflags();
 #define ARCH_UPDATEFLAGS()      create_updateflags()
 #define ADDITIONNAL_CHECKS()    additionnal_checks(dyn, ninst);
 #define ARCH_CRC_INLINE
+#define ARCH_TIERED
 extern void arm64_next_invalid();
 
 #define ARCH_NOP    0b11010101000000110010000000011111
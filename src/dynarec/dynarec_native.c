@@ -29,9 +29,12 @@
 KHASH_MAP_INIT_INT64(table64, uint32_t)
 KHASH_SET_INIT_INT64(nextset)
 KHASH_MAP_INIT_INT64(jumpaddr, int)
+KHASH_SET_INIT_INT64(tierhot)
 
 static kh_nextset_t* khnextset = NULL;
 static kh_jumpaddr_t* khjumpaddr = NULL;
+static kh_tierhot_t* khtierhot = NULL;  // address of quick blocks that got hot, and are to be built with full optimisations
+static pthread_mutex_t mutex_tierhot = PTHREAD_MUTEX_INITIALIZER; // khtierhot is also pruned on unmap, without mutex_dyndump
 
 void printf_x64_instruction(dynarec_native_t* dyn, zydis_dec_t* dec, instruction_x64_t* inst, const char* name) {
     uint8_t *ip = (uint8_t*)inst->addr;
@@ -230,6 +233,37 @@ int Table64(dynarec_native_t *dyn, uint64_t val, int pass)
     return delta;
 }
 
+void TierUpDynablock(uintptr_t addr)
+{
+    pthread_mutex_lock(&mutex_tierhot);
+    if(!khtierhot)
+        khtierhot = kh_init(tierhot);
+    int ret;
+    kh_put(tierhot, khtierhot, addr, &ret);
+    pthread_mutex_unlock(&mutex_tierhot);
+}
+
+void ForgetTierDynablock(uintptr_t addr, size_t size)
+{
+    if(!khtierhot || !kh_size(khtierhot))
+        return;
+    pthread_mutex_lock(&mutex_tierhot);
+    for(khint_t k=kh_begin(khtierhot); k!=kh_end(khtierhot); ++k)
+        if(kh_exist(khtierhot, k) && kh_key(khtierhot, k)>=addr && kh_key(khtierhot, k)-addr<size)
+            kh_del(tierhot, khtierhot, k);
+    pthread_mutex_unlock(&mutex_tierhot);
+}
+
+static int isTierHot(uintptr_t addr)
+{
+    if(!khtierhot)
+        return 0;
+    pthread_mutex_lock(&mutex_tierhot);
+    int ret = (kh_get(tierhot, khtierhot, addr)!=kh_end(khtierhot))?1:0;
+    pthread_mutex_unlock(&mutex_tierhot);
+    return ret;
+}
+
 void ResetTable64(dynarec_native_t* dyn)
 {
     dyn->table64size = 0;
@@ -427,6 +461,7 @@ dynablock_t* CreateEmptyBlock(uintptr_t addr, int is32bits, int is_new) {
     block->done = 0;
     block->size = sz;
     block->actual_block = actual_p;
+    block->state = AllocDynarecState((uintptr_t)actual_p);
     block->block = p;
     block->jmpnext = p;
     block->is32bits = is32bits;
@@ -515,6 +550,22 @@ dynablock_t* FillBlock64(uintptr_t addr, int is32bits, int inst_max, int is_new,
     helper.next_cap = MAX_INSTS;
     helper.table64 = NULL;
     helper.env = GetCurEnvByAddr(addr);
+    #ifdef ARCH_TIERED
+    // quick tier: no block extension, no callret optimisation and no secondary entry points,
+    // with a count down of executions to rebuild the block with the full optimisations once hot
+    box64env_t quick_env;
+    if(BOX64ENV(dynarec_tiered) && !isTierHot(old_addr)) {
+        quick_env = *helper.env;
+        quick_env.dynarec_bigblock = 0;
+        quick_env.is_dynarec_bigblock_overridden = 1;
+        quick_env.dynarec_callret = 0;
+        quick_env.is_dynarec_callret_overridden = 1;
+        quick_env.dynarec_sep = 0;
+        quick_env.is_dynarec_sep_overridden = 1;
+        helper.env = &quick_env;
+        helper.quick = 1;
+    }
+    #endif
     if(prot&PROT_NEVERCLEAN) {
         helper.always_test = 1;
     }
@@ -812,6 +863,7 @@ dynablock_t* FillBlock64(uintptr_t addr, int is32bits, int inst_max, int is_new,
             block->x64_readaddr = addr;
             block->isize = 0;
             block->actual_block = actual_p;
+            block->state = AllocDynarecState((uintptr_t)actual_p);
             helper.relocs = relocs;
             block->relocs = relocs;
             block->table64size = helper.table64size;
@@ -892,6 +944,9 @@ dynablock_t* FillBlock64(uintptr_t addr, int is32bits, int inst_max, int is_new,
             block->sep_size = helper.sep_size;
             block->sep = helper.sep;
             block->native_size = native_size;
+            #ifdef ARCH_TIERED
+            block->quick = helper.quick;
+            #endif
             *(dynablock_t**)next = block;
             for(int i=0; i<helper.sep_size; ++i) {
                 // setup the dynablock reference for secondary entry points
@@ -116,7 +116,7 @@ uintptr_t native_pass(dynarec_native_t* dyn, uintptr_t addr, int alternate, int
     #if STEP == 0
     memset(&dyn->insts[ninst], 0, sizeof(instruction_native_t));
     #ifdef ARM64
-    dyn->have_purge = BOX64ENV(dynarec_purge);
+    dyn->have_purge = BOX64ENV(dynarec_purge) || BOX64ENV(dynarec_cache_max);
     #endif
     #endif
     fpu_reset(dyn);
@@ -164,6 +164,8 @@ uintptr_t native_pass(dynarec_native_t* dyn, uintptr_t addr, int alternate, int
                 doEnterBlock(dyn, 0, x1, x2, x3);
             if(dyn->always_test)
                 checkCRC(dyn, 0);
+            if(dyn->quick)
+                doTierCount(dyn, 0, x1, x2, x3);
             if(dyn->insts[0].preload_xmmymm)
                 doPreload(dyn, 0);
             ENDPREFIX;
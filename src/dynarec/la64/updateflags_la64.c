@@ -78,6 +78,7 @@ void* create_updateflags()
     // fill the block
     block->x64_addr = &dummy_code;
     block->actual_block = actual_p;
+    block->state = AllocDynarecState((uintptr_t)actual_p);
     helper.relocs = relocs;
     block->relocs = relocs;
     block->table64size = helper.table64size;
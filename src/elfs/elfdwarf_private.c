@@ -719,3 +719,28 @@ void free_dwarf_unwind_registers(dwarf_unwind_t **unwind_struct) {
     box_free(*unwind_struct);
     *unwind_struct = NULL;
 }
+
+int get_fde_entries(const elfheader_t *ehdr, void (*f)(uintptr_t addr, void* data), void* data) {
+    if (!ehdr || !ehdr->ehframehdr || !IsAddressInElfSpace(ehdr, ehdr->ehframehdr+ehdr->delta))
+        return 0;
+    unsigned char *hdr_addr = (unsigned char*)(ehdr->ehframehdr+ehdr->delta);
+    unsigned char *cur_addr = hdr_addr;
+    uint8_t ehfh_version, eh_frame_ptr_enc, fde_count_enc, table_enc;
+    READ_U1(ehfh_version, cur_addr);
+    READ_U1(eh_frame_ptr_enc, cur_addr);
+    READ_U1(fde_count_enc, cur_addr);
+    READ_U1(table_enc, cur_addr);
+    // only the usual binary search table is handled: (initial location, FDE address) pairs, as datarel sdata4
+    if ((ehfh_version != 1) || (fde_count_enc == DW_EH_PE_omit) || (table_enc != (DW_EH_PE_datarel | DW_EH_PE_signed | DW_EH_PE_udata4)))
+        return 0;
+    SKIP_ENCODED(cur_addr, eh_frame_ptr_enc);
+    uint64_t fde_count;
+    READ_ENCODED(fde_count, cur_addr, fde_count_enc, 0);
+    for (uint64_t i = 0; i < fde_count; ++i) {
+        int32_t initial_loc;
+        READ_S4(initial_loc, cur_addr);
+        SKIP_4(cur_addr);
+        f((uintptr_t)hdr_addr + initial_loc, data);
+    }
+    return (int)fde_count;
+}
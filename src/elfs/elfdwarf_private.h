@@ -16,4 +16,7 @@ void free_dwarf_unwind_registers(dwarf_unwind_t **unwind_struct);
 // If success equals 2, the frame is a signal frame.
 uintptr_t get_parent_registers(dwarf_unwind_t *emu, const elfheader_t *ehdr, uintptr_t addr, char *success);
 
+// Calls f on the start address of every FDE listed in .eh_frame_hdr. Returns the number of FDEs found.
+int get_fde_entries(const elfheader_t *ehdr, void (*f)(uintptr_t addr, void* data), void* data);
+
 #endif // __ELFDWARF_PRIVATE_H_
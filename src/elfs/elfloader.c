@@ -22,6 +22,7 @@
 #include "debug.h"
 #include "elfload_dump.h"
 #include "elfloader_private.h"
+#include "elfdwarf_private.h"
 #include "librarian.h"
 #include "bridge.h"
 #include "alternate.h"
@@ -36,6 +37,7 @@
 #include "box64stack.h"
 #include "wine_tools.h"
 #include "dictionnary.h"
+#include "khash.h"
 #include "symbols.h"
 #include "cleanup.h"
 #include "globalsymbols.h"
@@ -1605,6 +1607,54 @@ void* GetDTatOffset(x64emu_t* emu, unsigned long int index, unsigned long int of
     return (void*)((char*)GetTLSPointer(emu, emu->context->elfs[index])+offset);
 }
 
+// the same address can come from .symtab, .dynsym and the FDE, only report it once
+KHASH_SET_INIT_INT64(codeentry)
+typedef struct codeentry_s {
+    kh_codeentry_t* done;
+    void (*f)(uintptr_t addr, void* data);
+    void* data;
+    int n;
+} codeentry_t;
+
+static void addCodeEntry(uintptr_t addr, void* data)
+{
+    codeentry_t* ce = data;
+    int ret;
+    kh_put(codeentry, ce->done, addr, &ret);
+    if(ret) {
+        ce->f(addr, ce->data);
+        ++ce->n;
+    }
+}
+
+int ElfForEachCodeEntry(elfheader_t* h, void (*f)(uintptr_t addr, void* data), void* data)
+{
+    if(!h || h->fini_done)
+        return 0;
+    codeentry_t ce = {kh_init(codeentry), f, data, 0};
+    for (size_t i=0; i<h->numSymTab; ++i) {
+        int type = box64_is32bits?ELF32_ST_TYPE(h->SymTab._32[i].st_info):ELF64_ST_TYPE(h->SymTab._64[i].st_info);
+        int shndx = box64_is32bits?h->SymTab._32[i].st_shndx:h->SymTab._64[i].st_shndx;
+        uintptr_t offs = box64_is32bits?h->SymTab._32[i].st_value:h->SymTab._64[i].st_value;
+        if(type==STT_FUNC && shndx!=SHN_UNDEF && offs)
+            addCodeEntry(offs + h->delta, &ce);
+    }
+    for (size_t i=0; i<h->numDynSym; ++i) {
+        int type = box64_is32bits?ELF32_ST_TYPE(h->DynSym._32[i].st_info):ELF64_ST_TYPE(h->DynSym._64[i].st_info);
+        int shndx = box64_is32bits?h->DynSym._32[i].st_shndx:h->DynSym._64[i].st_shndx;
+        uintptr_t offs = box64_is32bits?h->DynSym._32[i].st_value:h->DynSym._64[i].st_value;
+        if(type==STT_FUNC && shndx!=SHN_UNDEF && offs)
+            addCodeEntry(offs + h->delta, &ce);
+    }
+    get_fde_entries(h, addCodeEntry, &ce);
+    // PLT stubs are 16 bytes each
+    if(h->plt && h->plt_end>h->plt)
+        for(uintptr_t p=h->plt; p<h->plt_end; p+=16)
+            addCodeEntry(p + h->delta, &ce);
+    kh_destroy(codeentry, ce.done);
+    return ce.n;
+}
+
 int32_t GetTLSBase(elfheader_t* h)
 {
     return h?h->tlsbase:0;
@@ -0,0 +1 @@
+#define GITREV "6a7251f"
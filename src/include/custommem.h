@@ -36,6 +36,7 @@ typedef struct mmaplist_s mmaplist_t;
 // custom protection flag to mark Page that are Write protected for Dynarec purpose
 uintptr_t AllocDynarecMap(uintptr_t x64_addr, size_t size, int is_new);
 void FreeDynarecMap(uintptr_t addr);
+void* AllocDynarecState(uintptr_t addr);    // zeroed runtime state (dbstate_t) of the dynablock allocated at addr
 mmaplist_t* NewMmaplist();
 void DelMmaplist(mmaplist_t* list);
 int MmaplistHasNew(mmaplist_t* list, int clear);
@@ -43,6 +44,8 @@ int MmaplistIsDirty(mmaplist_t* list);
 int MmaplistNBlocks(mmaplist_t* list);
 size_t MmaplistTotalAlloc(mmaplist_t* list);
 void MmaplistFillBlocks(mmaplist_t* list, CompressedDynaCacheBlock_t* blocks);
+size_t MmaplistNProfile(mmaplist_t* list, uint32_t min_hits);
+void MmaplistFillProfile(mmaplist_t* list, uint32_t min_hits, DynaCacheProfile_t* profile);
 void MmaplistAddNBlocks(mmaplist_t* list, int nblocks);
 int MmaplistAddBlock(mmaplist_t* list, int fd, off_t offset, void* orig, size_t size, intptr_t delta_map, uintptr_t mapping_start);
 int MmaplistAddCompressedBlock(mmaplist_t* list, int type, void* src, size_t src_size, void* orig, size_t size, intptr_t delta_map, uintptr_t mapping_start);
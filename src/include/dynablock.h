@@ -20,6 +20,14 @@ dynablock_t* FindDynablockFromNativeAddress(void* addr);    // defined in box64c
 dynablock_t* DBGetBlock(x64emu_t* emu, uintptr_t addr, int create, int is32bits);   // return NULL if block is not found / cannot be created. Don't create if create==0
 dynablock_t* internalDBGetBlock(x64emu_t* emu, uintptr_t addr, int create, int need_lock, int is32bits, int is_new);
 void FlushZombieDynablocks(void);
+// background building of dynablocks (BOX64_DYNAREC_BACKGROUND)
+void ResetDynablockBuilder(void);
+void FiniDynablockBuilder(void);
+void ProfileDynablock(uintptr_t addr, int is32bits);    // hot entry point from a DynaCache profile
+// dispatch misses of entry points, for the DynaCache profile
+void CountDynablockHit(uintptr_t addr);
+uint32_t GetDynablockHits(uintptr_t addr);
+void ForgetDynablockHits(uintptr_t addr, size_t size);
 
 // for use in signal handler
 void cancelFillBlock(void);
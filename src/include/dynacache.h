@@ -24,6 +24,23 @@ typedef struct CompressedDynaCacheBlock_s {
     uint8_t     type;
 } CompressedDynaCacheBlock_t;
 
+// hot entry points, from the dispatch count of the blocks
+typedef struct DynaCacheProfile_s {
+    uintptr_t   addr;
+    uint32_t    hits;
+    uint32_t    is32bits;
+} DynaCacheProfile_t;
+
+// only write when the value changes: pages of a DynaCache file mapping that are not written
+// stay backed by the page cache, and so are shared by all the processes using the same cache.
+// The runtime counters and links of the blocks are in a private area out of the mapping (dbstate_t),
+// only an invalidation or a SEP conflict still writes to a block
+#define STORE_IF_CHANGED(A, V)              \
+    do {                                    \
+        __typeof__(A) store_v_ = (V);       \
+        if ((A) != store_v_) (A) = store_v_; \
+    } while (0)
+
 void SerializeMmaplist(mapping_t* mapping);
 void MmapDynaCache(mapping_t* mapping);
 #endif
@@ -11,5 +11,7 @@ void addInst(instsize_t* insts, size_t* size, int x64_size, int native_size);
 
 void CancelBlock64(int need_lock);
 dynablock_t* FillBlock64(uintptr_t addr, int is32bits, int inst_max, int is_new, int noalt);
+void TierUpDynablock(uintptr_t addr);   // next FillBlock64 at addr will use full optimisations
+void ForgetTierDynablock(uintptr_t addr, size_t size);  // range is unmapped, forget its hot addresses
 
 #endif //__DYNAREC_ARM_H_
@@ -69,6 +69,8 @@ uint32_t GetBaseSize(elfheader_t* h);
 int IsAddressInElfSpace(const elfheader_t* h, uintptr_t addr);
 elfheader_t* FindElfAddress(box64context_t *context, uintptr_t addr);
 const char* FindNearestSymbolName(elfheader_t* h, void* p, uintptr_t* start, uint64_t* sz);
+// call f on all code entry points of the elf (function symbols, eh_frame FDEs and PLT stubs), return the number of entries
+int ElfForEachCodeEntry(elfheader_t* h, void (*f)(uintptr_t addr, void* data), void* data);
 int32_t GetTLSBase(elfheader_t* h);
 uint32_t GetTLSSize(elfheader_t* h);
 void* GetTLSPointer(x64emu_t* emu, elfheader_t* h);
@@ -70,17 +70,21 @@ extern char* ftrace_name;
     INTEGER(BOX64_DYNAREC_SAFEFLAGS, dynarec_safeflags, 1, 0, 2, 1, 2)           \
     INTEGER(BOX64_DYNAREC_STRONGMEM, dynarec_strongmem, 0, 0, 4, 1, 3)           \
     BOOLEAN(BOX64_DYNAREC_TBB, dynarec_tbb, 1, 0, 0)                             \
+    BOOLEAN(BOX64_DYNAREC_TIERED, dynarec_tiered, 0, 0, 1)                       \
+    INTEGER(BOX64_DYNAREC_TIERED_THRESHOLD, dynarec_tiered_threshold, 1024, 16, 1048576, 0, 0) \
     STRING(BOX64_DYNAREC_TEST, dynarec_test_str, 1, 0)                           \
     BOOLEAN(BOX64_DYNAREC_TEST_NODUP, dynarec_test_nodup, 0, 1, 0)               \
     BOOLEAN(BOX64_DYNAREC_TEST_NODUMP, dynarec_test_nodump, 1, 1, 0)             \
     BOOLEAN(BOX64_DYNAREC_TRACE, dynarec_trace, 0, 0, 0)                         \
     BOOLEAN(BOX64_DYNAREC_VOLATILE_METADATA, dynarec_volatile_metadata, 1, 0, 1) \
     BOOLEAN(BOX64_DYNAREC_WAIT, dynarec_wait, 1, 1, 0)                           \
+    BOOLEAN(BOX64_DYNAREC_BACKGROUND, dynarec_background, 0, 0, 0)               \
     INTEGER(BOX64_DYNAREC_WEAKBARRIER, dynarec_weakbarrier, 1, 0, 2, 1, 2)       \
     INTEGER(BOX64_DYNAREC_X87DOUBLE, dynarec_x87double, 0, 0, 2, 1, 2)           \
     BOOLEAN(BOX64_DYNAREC_INTERP_SIGNAL, dynarec_interp_signal, 0, 0, 0)         \
     BOOLEAN(BOX64_DYNAREC_PURGE, dynarec_purge, 0, 0, 0)                         \
     INTEGER(BOX64_DYNAREC_PURGE_AGE, dynarec_purge_age, 4096, 10, 65536, 0, 0)   \
+    INTEGER(BOX64_DYNAREC_CACHE_MAX, dynarec_cache_max, 0, 0, 65536, 0, 0)       \
     BOOLEAN(BOX64_NODYNAREC_DELAY, nodynarec_delay, 0, 1, 0)                     \
     STRING(BOX64_EMULATED_LIBS, emulated_libs, 0, 0)                             \
     INTEGER(BOX64_DYNAREC_NOARCH, dynarec_noarch, 0, 0, 2, 1, 2)                 \
@@ -265,6 +269,7 @@ int IsAddrFileMapped(uintptr_t addr, const char** filename, uintptr_t* start);
 int IsAddrFileMappedNoMemFD(uintptr_t addr);
 size_t SizeFileMapped(uintptr_t addr);
 mmaplist_t* GetMmaplistByAddr(uintptr_t addr);
+void ForEachMappingMmaplist(void (*f)(mmaplist_t* list, void* data), void* data);   // mutex_dyndump must be held
 int IsAddrNeedReloc(uintptr_t addr);
 void SerializeAllMapping();
 int IsAddrMappingLoadAndClean(uintptr_t addr);
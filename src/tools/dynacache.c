@@ -91,7 +91,7 @@ done:
     `box64 --dynacache-clean` can be used from command line to purge obsolete DyaCache files
 */
 
-#define FILE_VERSION 6
+#define FILE_VERSION 9
 #define HEADER_SIGN  "DynaCache"
 
 typedef struct DynaCacheHeader_s {
@@ -114,6 +114,7 @@ typedef struct DynaCacheHeader_s {
     uint32_t    nblocks;
     uint32_t    nLockAddresses;
     uint32_t    nUnalignedAddresses;
+    uint32_t    nProfile;
     char        filename[];
 } DynaCacheHeader_t;
 
@@ -249,6 +250,17 @@ const char* NicePrintSize(size_t sz)
 }
 
 #ifndef WIN32
+static int DynaCacheProfileCmp(const void* a, const void* b)
+{
+    const DynaCacheProfile_t* pa = a;
+    const DynaCacheProfile_t* pb = b;
+    if(pa->hits > pb->hits)
+        return -1;
+    if(pa->hits < pb->hits)
+        return 1;
+    return (pa->addr > pb->addr) - (pa->addr < pb->addr);
+}
+
 typedef struct DynaCacheFileEntry_s {
     char* filename;
     uint64_t size;
@@ -264,6 +276,9 @@ int ReadDynaCache(const char* folder, const char* name, mapping_t* mapping, int
 
 #define DYNACACHE_TMP_STALE_SECONDS 60
 #define DYNACACHE_HASH_INIT UINT64_C(0)
+// the profile keeps the hottest entry points of a mapping, dispatched at least DYNACACHE_PROFILE_MIN times
+#define DYNACACHE_PROFILE_MIN 2
+#define DYNACACHE_PROFILE_MAX 4096
 
 static uint64_t DynaCacheHash(uint64_t hash, const void* data, size_t size)
 {
@@ -285,6 +300,7 @@ static size_t DynaCacheHeaderSize(const DynaCacheHeader_t* header)
     total += header->nblocks*sizeof(CompressedDynaCacheBlock_t);
     total += header->nLockAddresses*sizeof(uintptr_t);
     total += header->nUnalignedAddresses*sizeof(uintptr_t);
+    total += header->nProfile*sizeof(DynaCacheProfile_t);
     return ALIGN(total);
 }
 
@@ -471,14 +487,29 @@ void SerializeMmaplist(mapping_t* mapping)
     size_t map_len = SizeFileMapped(mapping->start);
     size_t nLockAddresses = nLockAddressRange(mapping->start, map_len);
     size_t nUnaligned = nUnalignedRange(mapping->start, map_len);
+    // collect the hot entry points, only the hottest ones are kept
+    size_t nProfile = MmaplistNProfile(mapping->mmaplist, DYNACACHE_PROFILE_MIN);
+    DynaCacheProfile_t* profile = NULL;
+    if(nProfile) {
+        profile = box_malloc(nProfile*sizeof(DynaCacheProfile_t));
+        if(!profile) return;
+        MmaplistFillProfile(mapping->mmaplist, DYNACACHE_PROFILE_MIN, profile);
+        qsort(profile, nProfile, sizeof(DynaCacheProfile_t), DynaCacheProfileCmp);
+        if(nProfile>DYNACACHE_PROFILE_MAX)
+            nProfile = DYNACACHE_PROFILE_MAX;
+    }
     DynaCacheHeader_t header_info = {0};
     header_info.filename_length = strlen(mapping->fullname);
     header_info.nblocks = nblocks;
     header_info.nLockAddresses = nLockAddresses;
     header_info.nUnalignedAddresses = nUnaligned;
+    header_info.nProfile = nProfile;
     size_t total = DynaCacheHeaderSize(&header_info);
     uint8_t* all_header = box_calloc(1, total);
-    if(!all_header) return;
+    if(!all_header) {
+        box_free(profile);
+        return;
+    }
     void* p = all_header;
     DynaCacheHeader_t* header = p;
     strcpy(header->sign, HEADER_SIGN);
@@ -497,12 +528,14 @@ void SerializeMmaplist(mapping_t* mapping)
     header->map_len = map_len;
     header->nLockAddresses = nLockAddresses;
     header->nUnalignedAddresses = nUnaligned;
+    header->nProfile = nProfile;
     size_t dynacache_min = box64env.dynacache_min;
     if(mapping->env && mapping->env->is_dynacache_min_overridden)
         dynacache_min = mapping->env->dynacache_min;
     if(dynacache_min*1024>header->codesize) {
         dynarec_log(LOG_INFO, "DynaCache will not serialize cache for %s because there is not enough usefull code (%s)\n", mapping->fullname, NicePrintSize(header->codesize));
         box_free(all_header);
+        box_free(profile);
         return; // not enugh code, do no write
     }
     p += sizeof(DynaCacheHeader_t); // fullname
@@ -514,10 +547,14 @@ void SerializeMmaplist(mapping_t* mapping)
     uintptr_t* lockAddresses = p;
     p += nLockAddresses*sizeof(uintptr_t);
     uintptr_t* unalignedAddresses = p;
+    p += nUnaligned*sizeof(uintptr_t);
     if(nLockAddresses)
         getLockAddressRange(mapping->start, map_len, lockAddresses);
     if(nUnaligned)
         getUnalignedRange(mapping->start, map_len, unalignedAddresses);
+    if(nProfile)
+        memcpy(p, profile, nProfile*sizeof(DynaCacheProfile_t));
+    box_free(profile);
     // all done, now just create the file and write all this down...
     #ifndef WIN32
     char tmpname[strlen(mapname)+64];
@@ -778,6 +815,7 @@ int ReadDynaCache(const char* folder, const char* name, mapping_t* mapping, int
     CompressedDynaCacheBlock_t* blocks = (CompressedDynaCacheBlock_t*)(map_filename + file_header->filename_length + 1);
     uintptr_t* lockAddresses = (uintptr_t*)(blocks + file_header->nblocks);
     uintptr_t* unalignedAddresses = lockAddresses + file_header->nLockAddresses;
+    DynaCacheProfile_t* profile = (DynaCacheProfile_t*)(unalignedAddresses + file_header->nUnalignedAddresses);
 
     off_t p = file_header->cache_header_size;
     uint64_t payload_hash = DYNACACHE_HASH_INIT;
@@ -876,6 +914,8 @@ int ReadDynaCache(const char* folder, const char* name, mapping_t* mapping, int
             n += snprintf(buf+n, sizeof(buf)-n, "\tMapped at %p-%p, with %zu lock and %zu unaligned addresses",
                 (void*)file_header->map_addr, (void*)file_header->map_addr+file_header->map_len,
                 (size_t)file_header->nLockAddresses, (size_t)file_header->nUnalignedAddresses);
+            if(file_header->nProfile && n>0 && n<(int)sizeof(buf))
+                n += snprintf(buf+n, sizeof(buf)-n, "\n\tProfile of %u hot entry points (hottest dispatched %u times)", file_header->nProfile, profile[0].hits);
             if(total_compressed && n>0 && n<(int)sizeof(buf)) {
                 n += snprintf(buf+n, sizeof(buf)-n, "\n\tCompression: %llu%% / %s compressed", 100ULL-total_compressed*100ULL/total_blocks ,NicePrintSize(total_compressed));
                 if(total_uncompressed && n>0 && n<(int)sizeof(buf))
@@ -917,6 +957,11 @@ int ReadDynaCache(const char* folder, const char* name, mapping_t* mapping, int
             addLockAddress(lockAddresses[i]+delta_map);
         for(size_t i=0; i<file_header->nUnalignedAddresses; ++i)
             add_unaligned_address(unalignedAddresses[i]+delta_map);
+        for(size_t i=0; i<file_header->nProfile; ++i) {
+            uintptr_t addr = profile[i].addr+delta_map;
+            if(addr>=mapping->start && addr<mapping->start+file_header->map_len)
+                ProfileDynablock(addr, profile[i].is32bits);
+        }
         if (verbose) printf_log_prefix(0, LOG_NONE, "Cache loaded successfully\n");
         dynarec_log(LOG_INFO, "Loaded DynaCache for %s, with %d blocks\n", mapping->fullname, file_header->nblocks);
         // try to update mtime for used cache file, so that it is less likely to be pruned
@@ -981,6 +981,17 @@ mmaplist_t* GetMmaplistByAddr(uintptr_t addr)
     #endif
 }
 
+void ForEachMappingMmaplist(void (*f)(mmaplist_t* list, void* data), void* data)
+{
+    #ifdef DYNAREC
+    if(!mapping_entries) return;
+    mapping_t* mapping;
+    kh_foreach_value(mapping_entries, mapping,
+        if(mapping->mmaplist)
+            f(mapping->mmaplist, data);
+    );
+    #endif
+}
 
 int IsAddrFileMapped(uintptr_t addr, const char** filename, uintptr_t* start)
 {